@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Fills the error_messages section of an abigen ABI from TOKEN_ERRORS.
+
+eosio-cpp -abigen does not emit error_messages, so the build runs this on
+its output:
+
+    abi_errors.py token.cpp build/token.abi
+"""
+
+import json
+import re
+import sys
+
+ERROR_ENTRY = re.compile(r'X\(\s*(\w+)\s*,\s*(\d+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+
+
+def read_errors(source_path):
+    with open(source_path) as f:
+        source = f.read()
+
+    start = source.find('#define TOKEN_ERRORS(X)')
+    if start < 0:
+        sys.exit('%s: TOKEN_ERRORS not found' % source_path)
+
+    # the macro ends at the first line without a continuation backslash
+    lines = []
+    for line in source[start:].splitlines():
+        lines.append(line)
+        if not line.rstrip().endswith('\\'):
+            break
+
+    errors = []
+    for ident, code, message in ERROR_ENTRY.findall('\n'.join(lines)):
+        errors.append({'error_code': int(code), 'error_msg': json.loads('"%s"' % message)})
+    if not errors:
+        sys.exit('%s: TOKEN_ERRORS is empty' % source_path)
+
+    codes = [e['error_code'] for e in errors]
+    if len(set(codes)) != len(codes):
+        sys.exit('%s: duplicate error code in TOKEN_ERRORS' % source_path)
+    return errors
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: abi_errors.py <token.cpp> <abi>')
+
+    source_path, abi_path = sys.argv[1:]
+    with open(abi_path) as f:
+        abi = json.load(f)
+
+    abi['error_messages'] = read_errors(source_path)
+
+    with open(abi_path, 'w') as f:
+        json.dump(abi, f, indent=4)
+
+
+if __name__ == '__main__':
+    main()
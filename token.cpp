@@ -4,15 +4,159 @@
  */
 
 #include <eosiolib/asset.hpp>
+#include <eosiolib/binary_extension.hpp>
+#include <eosiolib/crypto.hpp>
+#include <eosiolib/db.h>
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/print.hpp>
 #include <eosiolib/transaction.hpp>
 
+#include <algorithm>
+#include <limits>
 #include <string>
 
 using namespace eosio;
 using namespace std;
 
+// optional features, each one can be turned off with -DTOKEN_FEATURE_<NAME>=0;
+// -DTOKEN_MINIMAL turns all of them off unless enabled one by one
+#ifdef TOKEN_MINIMAL
+#define TOKEN_FEATURE_DEFAULT 0
+#else
+#define TOKEN_FEATURE_DEFAULT 1
+#endif
+
+// signed voucher settlement
+#ifndef TOKEN_FEATURE_VOUCHER
+#define TOKEN_FEATURE_VOUCHER TOKEN_FEATURE_DEFAULT
+#endif
+
+// payment channels, needs VOUCHER
+#ifndef TOKEN_FEATURE_CHANNEL
+#define TOKEN_FEATURE_CHANNEL TOKEN_FEATURE_DEFAULT
+#endif
+
+// merkle airdrops
+#ifndef TOKEN_FEATURE_AIRDROP
+#define TOKEN_FEATURE_AIRDROP TOKEN_FEATURE_DEFAULT
+#endif
+
+// recurring transfers
+#ifndef TOKEN_FEATURE_SUBSCRIPTION
+#define TOKEN_FEATURE_SUBSCRIPTION TOKEN_FEATURE_DEFAULT
+#endif
+
+// per-account outflow limit, checked in sub_balance
+#ifndef TOKEN_FEATURE_OUTFLOW_LIMIT
+#define TOKEN_FEATURE_OUTFLOW_LIMIT TOKEN_FEATURE_DEFAULT
+#endif
+
+// inflation schedule
+#ifndef TOKEN_FEATURE_INFLATION
+#define TOKEN_FEATURE_INFLATION TOKEN_FEATURE_DEFAULT
+#endif
+
+// scheduled caps, unissued burn and supply log
+#ifndef TOKEN_FEATURE_SUPPLY_SCHEDULE
+#define TOKEN_FEATURE_SUPPLY_SCHEDULE TOKEN_FEATURE_DEFAULT
+#endif
+
+// payment streams
+#ifndef TOKEN_FEATURE_STREAM
+#define TOKEN_FEATURE_STREAM TOKEN_FEATURE_DEFAULT
+#endif
+
+// order escrow
+#ifndef TOKEN_FEATURE_ESCROW
+#define TOKEN_FEATURE_ESCROW TOKEN_FEATURE_DEFAULT
+#endif
+
+// cross-chain bridge
+#ifndef TOKEN_FEATURE_BRIDGE
+#define TOKEN_FEATURE_BRIDGE TOKEN_FEATURE_DEFAULT
+#endif
+
+// balance merkle-sum tree, updated on every balance change
+#ifndef TOKEN_FEATURE_BALANCE_TREE
+#define TOKEN_FEATURE_BALANCE_TREE TOKEN_FEATURE_DEFAULT
+#endif
+
+// event ring buffer, appended by transfer/issue/retire
+#ifndef TOKEN_FEATURE_EVENT_LOG
+#define TOKEN_FEATURE_EVENT_LOG TOKEN_FEATURE_DEFAULT
+#endif
+
+#if TOKEN_FEATURE_CHANNEL && !TOKEN_FEATURE_VOUCHER
+#error "TOKEN_FEATURE_CHANNEL requires TOKEN_FEATURE_VOUCHER"
+#endif
+
+// error codes raised with eosio_assert_code; messages are not compiled into the wasm,
+// they are published in the error_messages section of token.abi
+#define TOKEN_ERRORS(X) \
+   X(ERR_STATUS_DISABLED, 1, "current status do not allow doing this action.") \
+   X(ERR_INIT_NOT_ALLOWED, 2, "not allow init.") \
+   X(ERR_INVALID_SYMBOL, 3, "invalid symbol name") \
+   X(ERR_INVALID_SUPPLY, 4, "invalid supply") \
+   X(ERR_MAX_SUPPLY_NOT_POSITIVE, 5, "max-supply must be positive") \
+   X(ERR_TOKEN_EXISTS, 6, "token with symbol already exists") \
+   X(ERR_TOKEN_NOT_FOUND, 7, "token with symbol does not exist") \
+   X(ERR_MEMO_TOO_LONG, 8, "memo has more than 256 bytes") \
+   X(ERR_INVALID_QUANTITY, 9, "invalid quantity") \
+   X(ERR_QUANTITY_NOT_POSITIVE, 10, "quantity must be positive") \
+   X(ERR_SYMBOL_MISMATCH, 11, "symbol precision mismatch") \
+   X(ERR_SUPPLY_EXCEEDED, 12, "quantity exceeds available supply") \
+   X(ERR_TO_SELF, 13, "cannot transfer to self") \
+   X(ERR_ACCOUNT_NOT_FOUND, 14, "to account does not exist") \
+   X(ERR_MAX_SUPPLY_BELOW_SUPPLY, 15, "maximum_supply must greater than current supply.") \
+   X(ERR_NO_BALANCE, 16, "no balance object found") \
+   X(ERR_OVERDRAWN, 17, "overdrawn balance") \
+   X(ERR_OVERDRAWN_LOCK, 18, "overdrawn lock balance") \
+   X(ERR_UNSTAKE_TIME_NOT_SET, 19, "unstake time not set.") \
+   X(ERR_ACCOUNT_ROW_TOO_LARGE, 20, "account row too large") \
+   X(ERR_OUTFLOW_LIMIT, 21, "outflow limit exceeded") \
+   X(ERR_NEGATIVE_LIMIT, 22, "limit must not be negative") \
+   X(ERR_EMPTY_BATCH, 23, "batch is empty") \
+   X(ERR_VOUCHER_KEY_NOT_FOUND, 24, "voucher key not registered") \
+   X(ERR_VOUCHER_NONCE, 25, "voucher nonce out of order") \
+   X(ERR_VOUCHER_PAIR, 26, "voucher does not belong to this pair") \
+   X(ERR_TIME_IN_PAST, 27, "time must be in the future") \
+   X(ERR_CHANNEL_NOT_FOUND, 28, "channel does not exist") \
+   X(ERR_CHANNEL_DEPOSIT_EXCEEDED, 29, "quantity exceeds channel deposit") \
+   X(ERR_CHANNEL_NOT_EXPIRED, 30, "channel has not expired") \
+   X(ERR_SENDER_CANNOT_SETTLE, 31, "sender cannot settle a payment") \
+   X(ERR_DROP_NOT_FOUND, 32, "drop does not exist") \
+   X(ERR_DROP_EXCEEDED, 33, "quantity exceeds remaining drop") \
+   X(ERR_INVALID_PROOF, 34, "invalid merkle proof") \
+   X(ERR_ALREADY_CLAIMED, 35, "already claimed") \
+   X(ERR_DROP_CLOSED, 36, "drop already closed") \
+   X(ERR_INVALID_INTERVAL, 37, "interval must be positive") \
+   X(ERR_SUBSCRIPTION_NOT_FOUND, 38, "subscription does not exist") \
+   X(ERR_INVALID_MAX_ROWS, 39, "max_rows must be positive") \
+   X(ERR_INVALID_RATE, 40, "annual rate is in basis points and cannot exceed 10000") \
+   X(ERR_NO_INFLATION, 41, "no inflation schedule") \
+   X(ERR_NOTHING_TO_INFLATE, 42, "nothing to inflate") \
+   X(ERR_NO_UNISSUED_SUPPLY, 43, "no unissued supply to burn") \
+   X(ERR_INVALID_STREAM_RANGE, 44, "stream must stop after it starts") \
+   X(ERR_STREAM_NOT_FOUND, 45, "stream does not exist") \
+   X(ERR_NOTHING_TO_WITHDRAW, 46, "nothing to withdraw") \
+   X(ERR_ESCROW_NOT_FOUND, 47, "escrow does not exist") \
+   X(ERR_INVALID_BRIDGE_RECIPIENT, 48, "invalid bridge recipient") \
+   X(ERR_BRIDGE_NOT_FOUND, 49, "bridge not configured for symbol") \
+   X(ERR_DEPOSIT_PROCESSED, 50, "deposit already processed") \
+   X(ERR_BRIDGE_EXCEEDED, 51, "deposits exceed bridged supply") \
+   X(ERR_INVALID_CONFIG_VALUE, 52, "config value is not an unsigned number") \
+   X(ERR_CHAIN_ID_NOT_SET, 53, "chain id not set") \
+   X(ERR_CHAIN_ID_SET, 54, "chain id already set") \
+   X(ERR_TREE_NODE_NOT_FOUND, 55, "balance tree node does not exist") \
+   X(ERR_BALANCE_TREE_DISABLED, 56, "token has a balance tree this build does not update")
+
+#define TOKEN_ERROR_CODE(ident, code, message) ident = code,
+enum error_code : uint64_t
+{
+   TOKEN_ERRORS(TOKEN_ERROR_CODE)
+};
+#undef TOKEN_ERROR_CODE
+
 CONTRACT token : public contract
 {
 public:
@@ -31,7 +175,7 @@ public:
       require_auth(_self);
 
       auto itr = configtable.find(CONFIG_INIT.value);
-      eosio_assert(itr == configtable.end() || itr->value == "0", "not allow init.");
+      eosio_assert_code(itr == configtable.end() || itr->value == "0", ERR_INIT_NOT_ALLOWED);
 
       set_config(CONFIG_STAKE_STATUS, "1");
       set_config(CONFIG_ISSUE_STATUS, "1");
@@ -46,18 +190,22 @@ public:
       require_auth(_self);
 
       auto sym = maximum_supply.symbol;
-      eosio_assert(sym.is_valid(), "invalid symbol name");
-      eosio_assert(maximum_supply.is_valid(), "invalid supply");
-      eosio_assert(maximum_supply.amount > 0, "max-supply must be positive");
+      eosio_assert_code(sym.is_valid(), ERR_INVALID_SYMBOL);
+      eosio_assert_code(maximum_supply.is_valid(), ERR_INVALID_SUPPLY);
+      eosio_assert_code(maximum_supply.amount > 0, ERR_MAX_SUPPLY_NOT_POSITIVE);
 
       stats statstable(_self, sym.code().raw());
       auto existing = statstable.find(sym.code().raw());
-      eosio_assert(existing == statstable.end(), "token with symbol already exists");
+      eosio_assert_code(existing == statstable.end(), ERR_TOKEN_EXISTS);
 
       statstable.emplace(_self, [&](auto &s) {
          s.supply.symbol = maximum_supply.symbol;
          s.max_supply = maximum_supply;
          s.issuer = issuer;
+#if TOKEN_FEATURE_BALANCE_TREE
+         s.inflation.emplace(inflation_schedule{0, issuer, 0});
+         s.balance_root.emplace(tree_child{});
+#endif
       });
    }
 
@@ -66,26 +214,29 @@ public:
       assert_status(CONFIG_ISSUE_STATUS);
 
       auto sym = quantity.symbol;
-      eosio_assert(sym.is_valid(), "invalid symbol name");
-      eosio_assert(memo.size() <= 256, "memo has more than 256 bytes");
+      eosio_assert_code(sym.is_valid(), ERR_INVALID_SYMBOL);
+      eosio_assert_code(memo.size() <= 256, ERR_MEMO_TOO_LONG);
 
       stats statstable(_self, sym.code().raw());
       auto existing = statstable.find(sym.code().raw());
-      eosio_assert(existing != statstable.end(), "token with symbol does not exist, create token before issue");
+      eosio_assert_code(existing != statstable.end(), ERR_TOKEN_NOT_FOUND);
       const auto &st = *existing;
 
       require_auth(st.issuer);
-      eosio_assert(quantity.is_valid(), "invalid quantity");
-      eosio_assert(quantity.amount > 0, "must issue positive quantity");
+      apply_supply_caps(statstable, st, st.issuer);
+      eosio_assert_code(quantity.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
 
-      eosio_assert(quantity.symbol == st.supply.symbol, "symbol precision mismatch");
-      eosio_assert(quantity.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
+      eosio_assert_code(quantity.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+      eosio_assert_code(quantity.amount <= st.max_supply.amount - st.supply.amount, ERR_SUPPLY_EXCEEDED);
 
       statstable.modify(st, same_payer, [&](auto &s) {
          s.supply += quantity;
       });
 
       add_balance(st.issuer, quantity, st.issuer);
+      // the issuer is credited here, the move on to `to` is logged by the inline transfer
+      append_event(EVENT_ISSUE, st.issuer, st.issuer, quantity);
 
       if (to != st.issuer)
       {
@@ -100,191 +251,1721 @@ public:
                    string memo)
    {
       assert_status(CONFIG_TRANSFER_STATUS);
-      eosio_assert(from != to, "cannot transfer to self");
+      eosio_assert_code(from != to, ERR_TO_SELF);
       require_auth(from);
-      eosio_assert(is_account(to), "to account does not exist");
+      eosio_assert_code(is_account(to), ERR_ACCOUNT_NOT_FOUND);
       auto sym = quantity.symbol.code();
       stats statstable(_self, sym.raw());
-      const auto &st = statstable.get(sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
 
       require_recipient(from);
       require_recipient(to);
 
-      eosio_assert(quantity.is_valid(), "invalid quantity");
-      eosio_assert(quantity.amount > 0, "must transfer positive quantity");
-      eosio_assert(quantity.symbol == st.supply.symbol, "symbol precision mismatch");
-      eosio_assert(memo.size() <= 256, "memo has more than 256 bytes");
+      eosio_assert_code(quantity.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(quantity.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+      eosio_assert_code(memo.size() <= 256, ERR_MEMO_TOO_LONG);
 
       auto payer = has_auth(to) ? to : from;
 
       sub_balance(from, quantity);
       add_balance(to, quantity, payer);
+      append_event(EVENT_TRANSFER, from, to, quantity);
    }
 
    ACTION reduceto(name issuer, asset maximum_supply)
    {
       auto sym = maximum_supply.symbol;
-      check(sym.is_valid(), "invalid symbol name");
+      eosio_assert_code(sym.is_valid(), ERR_INVALID_SYMBOL);
 
       stats statstable(get_self(), sym.code().raw());
       auto existing = statstable.find(sym.code().raw());
-      check(existing != statstable.end(), "token with symbol does not exist, create token before reduce");
+      eosio_assert_code(existing != statstable.end(), ERR_TOKEN_NOT_FOUND);
       const auto &st = *existing;
       //check(to == st.issuer, "tokens can only be issued to issuer account");
 
       require_auth(st.issuer);
-      check(maximum_supply.amount >= st.supply.amount, "maximum_supply must greater than current supply.");
+      apply_supply_caps(statstable, st, st.issuer);
+      eosio_assert_code(maximum_supply.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+      eosio_assert_code(maximum_supply.amount >= st.supply.amount, ERR_MAX_SUPPLY_BELOW_SUPPLY);
 
       statstable.modify(st, same_payer, [&](auto &s) {
          s.max_supply = maximum_supply;
       });
+      log_supply(st, SUPPLY_SET_CAP, current_time_point().sec_since_epoch(), st.issuer);
    }
 
    ACTION retire( const asset& quantity, const string& memo )
    {
       auto sym = quantity.symbol;
-      check( sym.is_valid(), "invalid symbol name" );
-      check( memo.size() <= 256, "memo has more than 256 bytes" );
+      eosio_assert_code( sym.is_valid(), ERR_INVALID_SYMBOL );
+      eosio_assert_code( memo.size() <= 256, ERR_MEMO_TOO_LONG );
 
       stats statstable( get_self(), sym.code().raw() );
       auto existing = statstable.find( sym.code().raw() );
-      check( existing != statstable.end(), "token with symbol does not exist" );
+      eosio_assert_code( existing != statstable.end(), ERR_TOKEN_NOT_FOUND );
       const auto& st = *existing;
 
       require_auth( st.issuer );
-      check( quantity.is_valid(), "invalid quantity" );
-      check( quantity.amount > 0, "must retire positive quantity" );
+      eosio_assert_code( quantity.is_valid(), ERR_INVALID_QUANTITY );
+      eosio_assert_code( quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE );
 
-      check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+      eosio_assert_code( quantity.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH );
 
       statstable.modify( st, same_payer, [&]( auto& s ) {
          s.supply -= quantity;
       });
 
       sub_balance( st.issuer, quantity );
+      append_event( EVENT_RETIRE, st.issuer, st.issuer, quantity );
    }
 
 #pragma endregion
 
-#pragma region TABLE
+   struct voucher
+   {
+      name from;
+      name to;
+      asset quantity;
+      uint64_t nonce;
+      signature sig;
+   };
 
-   TABLE account
+#if TOKEN_FEATURE_VOUCHER
+#pragma region voucher
+
+   // contracts cannot read the chain id, so the account owner records it once before
+   // any voucher is signed; it is part of every voucher and channel digest
+   ACTION setchainid(checksum256 chain_id)
    {
-      asset balance;
-      asset lock_balance;
-      asset stake_balance;
+      require_auth(_self);
 
-      uint64_t primary_key() const { return balance.symbol.code().raw(); }
-   };
+      chaininfos chaintable(_self, _self.value);
+      eosio_assert_code(chaintable.find(0) == chaintable.end(), ERR_CHAIN_ID_SET);
+      chaintable.emplace(_self, [&](auto &c) {
+         c.chain_id = chain_id;
+      });
+   }
 
-   TABLE currency_stats
+   ACTION regvkey(name owner, public_key key)
    {
-      asset supply;
-      asset max_supply;
-      name issuer;
+      require_auth(owner);
 
-      uint64_t primary_key() const { return supply.symbol.code().raw(); }
-   };
+      voucherkeys keytable(_self, _self.value);
+      auto itr = keytable.find(owner.value);
+      if (itr == keytable.end())
+      {
+         keytable.emplace(owner, [&](auto &k) {
+            k.owner = owner;
+            k.key = key;
+         });
+      }
+      else
+      {
+         keytable.modify(itr, same_payer, [&](auto &k) {
+            k.key = key;
+         });
+      }
+   }
 
-   TABLE config_table
+   ACTION settle(name submitter, vector<voucher> vouchers)
    {
-      name key;
-      string value;
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(submitter);
+      eosio_assert_code(!vouchers.empty(), ERR_EMPTY_BATCH);
 
-      uint64_t primary_key() const { return key.value; }
-   };
+      // every voucher must be between the same pair of accounts, in either direction
+      const name a = vouchers.front().from;
+      const name b = vouchers.front().to;
+      const auto sym = vouchers.front().quantity.symbol;
+      eosio_assert_code(a != b, ERR_TO_SELF);
+      eosio_assert_code(is_account(b), ERR_ACCOUNT_NOT_FOUND);
 
-   TABLE stake_stats
+      stats statstable(_self, sym.code().raw());
+      const auto &st = get_row(statstable, sym.code().raw(), ERR_TOKEN_NOT_FOUND);
+      eosio_assert_code(sym == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      asset a_to_b(0, sym), b_to_a(0, sym);
+      uint64_t a_nonce = get_voucher_nonce(a, b);
+      uint64_t b_nonce = get_voucher_nonce(b, a);
+
+      for (const auto &v : vouchers)
+      {
+         eosio_assert_code(v.quantity.symbol == sym, ERR_SYMBOL_MISMATCH);
+         eosio_assert_code(v.quantity.is_valid(), ERR_INVALID_QUANTITY);
+         eosio_assert_code(v.quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+
+         if (v.from == a && v.to == b)
+         {
+            // consecutive nonces, so settling a later voucher cannot cancel earlier unsettled ones
+            eosio_assert_code(v.nonce == a_nonce + 1, ERR_VOUCHER_NONCE);
+            a_nonce = v.nonce;
+            a_to_b += v.quantity;
+         }
+         else if (v.from == b && v.to == a)
+         {
+            eosio_assert_code(v.nonce == b_nonce + 1, ERR_VOUCHER_NONCE);
+            b_nonce = v.nonce;
+            b_to_a += v.quantity;
+         }
+         else
+         {
+            eosio_assert_code(false, ERR_VOUCHER_PAIR);
+         }
+
+         assert_voucher_sig(v.from, voucher_digest(v), v.sig);
+      }
+
+      require_recipient(a);
+      require_recipient(b);
+
+      if (a_to_b.amount > 0)
+         set_voucher_nonce(a, b, a_nonce, submitter);
+      if (b_to_a.amount > 0)
+         set_voucher_nonce(b, a, b_nonce, submitter);
+
+      if (a_to_b > b_to_a)
+      {
+         sub_balance(a, a_to_b - b_to_a);
+         add_balance(b, a_to_b - b_to_a, submitter);
+      }
+      else if (b_to_a > a_to_b)
+      {
+         sub_balance(b, b_to_a - a_to_b);
+         add_balance(a, b_to_a - a_to_b, submitter);
+      }
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_CHANNEL
+#pragma region channel
+
+   ACTION chopen(name sender, name recipient, asset deposit, uint32_t expires)
    {
-      asset staking;
-      asset unstaking;
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(sender);
+      eosio_assert_code(sender != recipient, ERR_TO_SELF);
+      eosio_assert_code(is_account(recipient), ERR_ACCOUNT_NOT_FOUND);
+      eosio_assert_code(expires > current_time_point().sec_since_epoch(), ERR_TIME_IN_PAST);
 
-      uint64_t primary_key() const { return staking.symbol.code().raw(); }
-   };
+      auto sym = deposit.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
 
-   TABLE staking_log
+      eosio_assert_code(deposit.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(deposit.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(deposit.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      // the key is pinned at open, so re-registering it cannot change what a channel accepts
+      voucherkeys keytable(_self, _self.value);
+      const auto &k = get_row(keytable, sender.value, ERR_VOUCHER_KEY_NOT_FOUND);
+
+      // ids are never reused, so a signature for a closed channel cannot settle a new one
+      channelstates statetable(_self, _self.value);
+      auto state = statetable.find(0);
+      if (state == statetable.end())
+      {
+         state = statetable.emplace(sender, [&](auto &s) {
+            s.next_id = 0;
+         });
+      }
+      const uint64_t id = state->next_id;
+      statetable.modify(state, same_payer, [&](auto &s) {
+         ++s.next_id;
+      });
+
+      channels channeltable(_self, _self.value);
+      channeltable.emplace(sender, [&](auto &c) {
+         c.id = id;
+         c.sender = sender;
+         c.recipient = recipient;
+         c.deposit = deposit;
+         c.expires = expires;
+         c.sender_key = k.key;
+      });
+
+      add_lock_balance(sender, deposit);
+   }
+
+   ACTION chclose(uint64_t id, asset quantity, signature sig)
    {
-      name user;
-      asset asset;
+      assert_status(CONFIG_TRANSFER_STATUS);
 
-      uint64_t primary_key() const { return user.value; }
-   };
+      channels channeltable(_self, _self.value);
+      const auto &c = get_row(channeltable, id, ERR_CHANNEL_NOT_FOUND);
 
-   TABLE unstaking_log
+      eosio_assert_code(quantity.symbol == c.deposit.symbol, ERR_SYMBOL_MISMATCH);
+      eosio_assert_code(quantity.amount >= 0 && quantity <= c.deposit, ERR_CHANNEL_DEPOSIT_EXCEEDED);
+
+      name payer;
+      if (has_auth(c.recipient))
+      {
+         // recipient settles with the latest amount signed by the sender
+         assert_recover_key(channel_digest(c, quantity), sig, c.sender_key);
+         payer = c.recipient;
+      }
+      else
+      {
+         // sender may only reclaim the whole deposit once the channel expired
+         require_auth(c.sender);
+         eosio_assert_code(current_time_point().sec_since_epoch() >= c.expires, ERR_CHANNEL_NOT_EXPIRED);
+         eosio_assert_code(quantity.amount == 0, ERR_SENDER_CANNOT_SETTLE);
+         payer = c.sender;
+      }
+
+      require_recipient(c.sender);
+      require_recipient(c.recipient);
+
+      const name sender = c.sender;
+      const name recipient = c.recipient;
+      const asset deposit = c.deposit;
+      channeltable.erase(c);
+
+      release_lock_balance(sender, deposit, quantity);
+      if (quantity.amount > 0)
+         add_balance(recipient, quantity, payer);
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_AIRDROP
+#pragma region airdrop
+
+   ACTION mkdrop(name creator, checksum256 root, asset total)
    {
-      name user;
-      asset asset;
-      uint64_t request_time;
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(creator);
 
-      uint64_t primary_key() const { return user.value; }
-   };
+      auto sym = total.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+
+      eosio_assert_code(total.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(total.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(total.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      drops droptable(_self, _self.value);
+      droptable.emplace(creator, [&](auto &d) {
+         d.id = droptable.available_primary_key();
+         d.creator = creator;
+         d.remaining = total;
+         d.root = root;
+      });
 
-   typedef multi_index<"config"_n, config_table> configs;
+      // the pool moves into the contract's custody row, so supply stays fully held by rows
+      sub_balance(creator, total);
+      lock_custody(total);
+   }
 
-   typedef multi_index<"stakestats"_n, stake_stats> stakestats;
-   typedef multi_index<"stakinglog"_n, staking_log> stakinglog;
-   typedef multi_index<"unstakinglog"_n, unstaking_log> unstakinglog;
+   ACTION claim(uint64_t drop_id, uint64_t index, name account, asset amount, vector<checksum256> proof)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(account);
 
-   typedef multi_index<"accounts"_n, account> accounts;
-   typedef multi_index<"stat"_n, currency_stats> stats;
+      drops droptable(_self, _self.value);
+      const auto &d = get_row(droptable, drop_id, ERR_DROP_NOT_FOUND);
+
+      eosio_assert_code(amount.symbol == d.remaining.symbol, ERR_SYMBOL_MISMATCH);
+      eosio_assert_code(amount.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(amount <= d.remaining, ERR_DROP_EXCEEDED);
+
+      auto leaf = pack(std::make_tuple(drop_id, index, account, amount));
+      eosio_assert_code(merkle_root(sha256(leaf.data(), leaf.size()), proof) == d.root, ERR_INVALID_PROOF);
+
+      claimbits bittable(_self, drop_id);
+      eosio_assert_code(set_bit(bittable, index, account), ERR_ALREADY_CLAIMED);
+
+      droptable.modify(d, same_payer, [&](auto &r) {
+         r.remaining -= amount;
+      });
+
+      release_lock_balance(_self, amount, amount);
+      add_balance(account, amount, account);
+   }
+
+   ACTION closedrop(uint64_t drop_id)
+   {
+      drops droptable(_self, _self.value);
+      const auto &d = get_row(droptable, drop_id, ERR_DROP_NOT_FOUND);
+      require_auth(d.creator);
+
+      const asset remaining = d.remaining;
+      eosio_assert_code(remaining.amount > 0, ERR_DROP_CLOSED);
+
+      // the row is kept so the id, and the claims recorded under it, are never reused
+      droptable.modify(d, same_payer, [&](auto &r) {
+         r.remaining.amount = 0;
+      });
+
+      release_lock_balance(_self, remaining, remaining);
+      add_balance(d.creator, remaining, d.creator);
+   }
 
 #pragma endregion
+#endif
 
-private:
-   configs configtable;
+#if TOKEN_FEATURE_SUBSCRIPTION
+#pragma region subscription
 
-   const name CONFIG_INIT = "init"_n;
-   const name CONFIG_STAKE_STATUS = "sstatus"_n;
-   const name CONFIG_ISSUE_STATUS = "istatus"_n;
-   const name CONFIG_TRANSFER_STATUS = "tstatus"_n;
-   const name CONFIG_UNSTAKE_TIME = "unstaketime"_n;
+   ACTION subscribe(name payer, name payee, asset quantity, uint32_t interval)
+   {
+      require_auth(payer);
+      eosio_assert_code(payer != payee, ERR_TO_SELF);
+      eosio_assert_code(is_account(payee), ERR_ACCOUNT_NOT_FOUND);
+      eosio_assert_code(interval > 0, ERR_INVALID_INTERVAL);
 
-   void sub_balance(name owner, asset value)
+      auto sym = quantity.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+
+      eosio_assert_code(quantity.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(quantity.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      subscriptions subtable(_self, _self.value);
+      subtable.emplace(payer, [&](auto &s) {
+         s.id = subtable.available_primary_key();
+         s.payer = payer;
+         s.payee = payee;
+         s.quantity = quantity;
+         s.interval = interval;
+         s.next_due = current_time_point().sec_since_epoch();
+      });
+
+      // open the payee row now, so execute never has to pay RAM for it
+      if (find_account(payee, sym) < 0)
+         add_balance(payee, asset(0, quantity.symbol), payer);
+   }
+
+   ACTION unsubscribe(uint64_t id)
    {
-      accounts from_acnts(_self, owner.value);
+      subscriptions subtable(_self, _self.value);
+      const auto &s = get_row(subtable, id, ERR_SUBSCRIPTION_NOT_FOUND);
+      if (!has_auth(s.payee))
+         require_auth(s.payer);
 
-      const auto &from = from_acnts.get(value.symbol.code().raw(), "no balance object found");
-      eosio_assert(from.balance.amount - from.lock_balance.amount - from.stake_balance.amount >= value.amount, "overdrawn balance");
+      subtable.erase(s);
+   }
 
-      auto payer = has_auth(owner) ? owner : same_payer;
+   ACTION execute(uint32_t max_rows)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      eosio_assert_code(max_rows > 0, ERR_INVALID_MAX_ROWS);
+
+      const uint32_t now = current_time_point().sec_since_epoch();
+
+      subscriptions subtable(_self, _self.value);
+      auto dueidx = subtable.get_index<"bydue"_n>();
 
-      from_acnts.modify(from, payer, [&](auto &a) {
-         a.balance -= value;
+      vector<const subscription *> due;
+      for (auto itr = dueidx.begin(); itr != dueidx.end() && itr->next_due <= now && due.size() < max_rows; ++itr)
+         due.push_back(&*itr);
+
+      // group by payer row so each payer balance is read and written once
+      std::sort(due.begin(), due.end(), [](const subscription *l, const subscription *r) {
+         if (l->payer != r->payer)
+            return l->payer < r->payer;
+         return l->quantity.symbol.code().raw() < r->quantity.symbol.code().raw();
       });
+
+      for (size_t i = 0; i < due.size();)
+      {
+         const name payer = due[i]->payer;
+         const symbol sym = due[i]->quantity.symbol;
+
+         const int32_t from = find_account(payer, sym.code());
+         account acnt;
+         asset available(0, sym);
+         if (from >= 0)
+         {
+            acnt = read_account(from);
+            available.amount = std::min(acnt.balance.amount - acnt.lock_balance.amount - acnt.stake_balance.amount,
+                                        outflow_allowance(acnt));
+         }
+
+         asset paid(0, sym);
+         for (; i < due.size() && due[i]->payer == payer && due[i]->quantity.symbol == sym; ++i)
+         {
+            const auto &s = *due[i];
+            if (s.quantity.amount > available.amount - paid.amount)
+            {
+               // a payment that cannot be covered lapses the subscription
+               subtable.erase(s);
+               continue;
+            }
+
+            // no notifications here: one payee or payer contract rejecting them would stall the whole queue
+            paid += s.quantity;
+            add_balance(s.payee, s.quantity, _self);
+
+            subtable.modify(s, same_payer, [&](auto &r) {
+               r.next_due += r.interval;
+            });
+         }
+
+         if (paid.amount > 0)
+         {
+            const asset before = acnt.balance;
+            consume_outflow(acnt, paid.amount);
+            acnt.balance -= paid;
+            write_account(payer, from, acnt, same_payer);
+            commit_balance(payer, before, acnt.balance, same_payer);
+         }
+      }
    }
 
-   void add_balance(name owner, asset value, name ram_payer)
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_OUTFLOW_LIMIT
+#pragma region limit
+
+   ACTION setlimit(name owner, symbol_code sym, int64_t capacity, int64_t refill_rate)
+   {
+      require_auth(owner);
+      eosio_assert_code(capacity >= 0 && refill_rate >= 0, ERR_NEGATIVE_LIMIT);
+
+      int32_t itr;
+      account acnt = get_account(owner, sym, itr);
+
+      // an owner may tighten its own limit, loosening it also needs the contract
+      const bool limited = acnt.limit.has_value() && acnt.limit.value().capacity > 0;
+      if (limited)
+      {
+         const auto &l = acnt.limit.value();
+         if (capacity == 0 || capacity > l.capacity || refill_rate > l.refill_rate)
+            require_auth(_self);
+      }
+
+      const int64_t tokens = limited ? std::min(outflow_allowance(acnt), capacity) : capacity;
+      acnt.limit.emplace(outflow_limit{capacity, refill_rate, tokens, current_time_point().sec_since_epoch()});
+      // the row grows by the limit, the owner pays for it rather than whoever opened the row
+      write_account(owner, itr, acnt, owner);
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_INFLATION
+#pragma region inflation
+
+   ACTION setinflation(symbol_code sym, uint32_t annual_rate, name recipient)
+   {
+      eosio_assert_code(annual_rate <= 10000, ERR_INVALID_RATE);
+      eosio_assert_code(is_account(recipient), ERR_ACCOUNT_NOT_FOUND);
+
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+      require_auth(st.issuer);
+      apply_supply_caps(statstable, st, st.issuer);
+
+      // accrual up to now belongs to the schedule being replaced, unless issuing is disabled,
+      // in which case it lapses just as inflate would refuse to mint it
+      name accrued_to;
+      asset accrued(0, st.supply.symbol);
+      if (st.inflation.has_value() && st.inflation.value().annual_rate > 0 && status_enabled(CONFIG_ISSUE_STATUS))
+      {
+         accrued_to = st.inflation.value().recipient;
+         accrued = accrue_inflation(statstable, st);
+      }
+
+      statstable.modify(st, same_payer, [&](auto &s) {
+         s.inflation.emplace(inflation_schedule{annual_rate, recipient, current_time_point().sec_since_epoch()});
+      });
+
+      if (find_account(recipient, sym) < 0)
+         add_balance(recipient, asset(0, st.supply.symbol), st.issuer);
+
+      if (accrued.amount > 0)
+         add_balance(accrued_to, accrued, _self);
+   }
+
+   ACTION inflate(symbol_code sym)
+   {
+      assert_status(CONFIG_ISSUE_STATUS);
+
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+      eosio_assert_code(st.inflation.has_value() && st.inflation.value().annual_rate > 0, ERR_NO_INFLATION);
+      apply_supply_caps(statstable, st, _self);
+
+      const name recipient = st.inflation.value().recipient;
+      const asset accrued = accrue_inflation(statstable, st);
+      eosio_assert_code(accrued.amount > 0, ERR_NOTHING_TO_INFLATE);
+
+      add_balance(recipient, accrued, _self);
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_SUPPLY_SCHEDULE
+#pragma region supply
+
+   ACTION schedcap(asset maximum_supply, uint32_t effective)
    {
-      accounts to_acnts(_self, owner.value);
-      auto to = to_acnts.find(value.symbol.code().raw());
-      if (to == to_acnts.end())
+      auto sym = maximum_supply.symbol;
+      eosio_assert_code(sym.is_valid(), ERR_INVALID_SYMBOL);
+      eosio_assert_code(maximum_supply.is_valid() && maximum_supply.amount >= 0, ERR_INVALID_SUPPLY);
+      eosio_assert_code(effective > current_time_point().sec_since_epoch(), ERR_TIME_IN_PAST);
+
+      stats statstable(_self, sym.code().raw());
+      const auto &st = get_row(statstable, sym.code().raw(), ERR_TOKEN_NOT_FOUND);
+      require_auth(st.issuer);
+      eosio_assert_code(sym == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      supplycaps captable(_self, sym.code().raw());
+      auto itr = captable.find(effective);
+      if (itr == captable.end())
       {
-         to_acnts.emplace(ram_payer, [&](auto &a) {
-            a.balance = value;
-            a.lock_balance = asset(0, value.symbol);
-            a.stake_balance = asset(0, value.symbol);
+         captable.emplace(st.issuer, [&](auto &c) {
+            c.effective = effective;
+            c.max_supply = maximum_supply;
          });
       }
       else
       {
-         to_acnts.modify(to, same_payer, [&](auto &a) {
-            a.balance += value;
+         captable.modify(itr, same_payer, [&](auto &c) {
+            c.max_supply = maximum_supply;
          });
       }
    }
 
-   void assert_status(name key)
+   ACTION burnunissued(symbol_code sym)
    {
-      auto itr = configtable.find(key.value);
-      eosio_assert(itr != configtable.end() && stoul(itr->value) > 0, "current status do not allow doing this action.");
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+      require_auth(st.issuer);
+
+      apply_supply_caps(statstable, st, st.issuer);
+      eosio_assert_code(st.max_supply.amount > st.supply.amount, ERR_NO_UNISSUED_SUPPLY);
+
+      statstable.modify(st, same_payer, [&](auto &s) {
+         s.max_supply = s.supply;
+      });
+      log_supply(st, SUPPLY_BURN_UNISSUED, current_time_point().sec_since_epoch(), st.issuer);
    }
 
-   uint64_t get_unstake_time()
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_STREAM
+#pragma region stream
+
+   ACTION mkstream(name sender, name recipient, asset rate, uint32_t start, uint32_t stop)
    {
-      auto unstake_time = configtable.find(CONFIG_UNSTAKE_TIME.value);
-      eosio_assert(unstake_time != configtable.end(), "unstake time not set.");
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(sender);
+      eosio_assert_code(sender != recipient, ERR_TO_SELF);
+      eosio_assert_code(is_account(recipient), ERR_ACCOUNT_NOT_FOUND);
+      eosio_assert_code(start >= current_time_point().sec_since_epoch(), ERR_TIME_IN_PAST);
+      eosio_assert_code(stop > start, ERR_INVALID_STREAM_RANGE);
+
+      auto sym = rate.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+
+      eosio_assert_code(rate.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(rate.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(rate.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      streams streamtable(_self, _self.value);
+      streamtable.emplace(sender, [&](auto &s) {
+         s.id = streamtable.available_primary_key();
+         s.sender = sender;
+         s.recipient = recipient;
+         s.rate = rate;
+         s.withdrawn = asset(0, rate.symbol);
+         s.start = start;
+         s.stop = stop;
+      });
+
+      add_lock_balance(sender, rate * int64_t(stop - start));
+   }
+
+   ACTION withdraw(uint64_t id)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+
+      streams streamtable(_self, _self.value);
+      const auto &s = get_row(streamtable, id, ERR_STREAM_NOT_FOUND);
+      require_auth(s.recipient);
+
+      const asset amount = streamed(s) - s.withdrawn;
+      eosio_assert_code(amount.amount > 0, ERR_NOTHING_TO_WITHDRAW);
+
+      require_recipient(s.sender);
+
+      const name sender = s.sender;
+      const name recipient = s.recipient;
+      if (s.withdrawn + amount == s.rate * int64_t(s.stop - s.start))
+      {
+         streamtable.erase(s);
+      }
+      else
+      {
+         streamtable.modify(s, same_payer, [&](auto &r) {
+            r.withdrawn += amount;
+         });
+      }
+
+      release_lock_balance(sender, amount, amount);
+      add_balance(recipient, amount, recipient);
+   }
+
+   ACTION cancelstream(uint64_t id)
+   {
+      streams streamtable(_self, _self.value);
+      const auto &s = get_row(streamtable, id, ERR_STREAM_NOT_FOUND);
+      const name payer = has_auth(s.recipient) ? s.recipient : s.sender;
+      require_auth(payer);
+
+      require_recipient(s.sender);
+      require_recipient(s.recipient);
+
+      // the recipient keeps what has streamed so far, the rest is unlocked for the sender
+      const name sender = s.sender;
+      const name recipient = s.recipient;
+      const asset owed = streamed(s) - s.withdrawn;
+      const asset locked = s.rate * int64_t(s.stop - s.start) - s.withdrawn;
+      streamtable.erase(s);
+
+      release_lock_balance(sender, locked, owed);
+      if (owed.amount > 0)
+         add_balance(recipient, owed, payer);
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_ESCROW
+#pragma region escrow
+
+   ACTION mkescrow(name buyer, name seller, asset quantity, uint32_t expires)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(buyer);
+      eosio_assert_code(buyer != seller, ERR_TO_SELF);
+      eosio_assert_code(is_account(seller), ERR_ACCOUNT_NOT_FOUND);
+      eosio_assert_code(expires > current_time_point().sec_since_epoch(), ERR_TIME_IN_PAST);
+
+      auto sym = quantity.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+
+      eosio_assert_code(quantity.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(quantity.symbol == st.supply.symbol, ERR_SYMBOL_MISMATCH);
+
+      escrows escrowtable(_self, _self.value);
+      escrowtable.emplace(buyer, [&](auto &e) {
+         e.id = escrowtable.available_primary_key();
+         e.buyer = buyer;
+         e.seller = seller;
+         e.quantity = quantity;
+         e.expires = expires;
+      });
+
+      add_lock_balance(buyer, quantity);
+
+      // open the seller row now, so a batch release never has to pay RAM for it
+      if (find_account(seller, sym) < 0)
+         add_balance(seller, asset(0, quantity.symbol), buyer);
+   }
+
+   ACTION release(uint64_t id)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+
+      escrows escrowtable(_self, _self.value);
+      const auto &e = get_row(escrowtable, id, ERR_ESCROW_NOT_FOUND);
+      require_auth(e.buyer);
+
+      require_recipient(e.buyer);
+      require_recipient(e.seller);
+      close_escrow(escrowtable, e, true);
+   }
+
+   ACTION refund(uint64_t id)
+   {
+      escrows escrowtable(_self, _self.value);
+      const auto &e = get_row(escrowtable, id, ERR_ESCROW_NOT_FOUND);
+      require_auth(e.seller);
+
+      require_recipient(e.buyer);
+      require_recipient(e.seller);
+      close_escrow(escrowtable, e, false);
+   }
+
+   ACTION releasebatch(uint32_t max_rows)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      eosio_assert_code(max_rows > 0, ERR_INVALID_MAX_ROWS);
 
-      return stoull(unstake_time->value);
+      const uint32_t now = current_time_point().sec_since_epoch();
+
+      escrows escrowtable(_self, _self.value);
+      auto expiryidx = escrowtable.get_index<"byexpiry"_n>();
+
+      // expired escrows that were neither released nor refunded go to the seller; no notifications,
+      // so one party rejecting them cannot hold up every escrow behind it
+      for (auto itr = expiryidx.begin(); itr != expiryidx.end() && itr->expires <= now && max_rows > 0; --max_rows)
+      {
+         const auto &e = *itr++;
+         close_escrow(escrowtable, e, true);
+      }
+   }
+
+#pragma endregion
+#endif
+
+   struct bridge_deposit
+   {
+      uint64_t nonce;
+      name to;
+      asset quantity;
+   };
+
+#if TOKEN_FEATURE_BRIDGE
+#pragma region bridge
+
+   ACTION setrelayer(symbol_code sym, public_key relayer)
+   {
+      require_auth(_self);
+
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+
+      bridges bridgetable(_self, _self.value);
+      auto itr = bridgetable.find(sym.raw());
+      if (itr == bridgetable.end())
+      {
+         bridgetable.emplace(_self, [&](auto &b) {
+            b.locked = asset(0, st.supply.symbol);
+            b.relayer = relayer;
+            b.next_nonce = 0;
+         });
+      }
+      else
+      {
+         bridgetable.modify(itr, same_payer, [&](auto &b) {
+            b.relayer = relayer;
+         });
+      }
+   }
+
+   ACTION lockout(name from, asset quantity, string recipient)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(from);
+      eosio_assert_code(!recipient.empty() && recipient.size() <= 64, ERR_INVALID_BRIDGE_RECIPIENT);
+
+      bridges bridgetable(_self, _self.value);
+      const auto &b = get_row(bridgetable, quantity.symbol.code().raw(), ERR_BRIDGE_NOT_FOUND);
+
+      eosio_assert_code(quantity.is_valid(), ERR_INVALID_QUANTITY);
+      eosio_assert_code(quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+      eosio_assert_code(quantity.symbol == b.locked.symbol, ERR_SYMBOL_MISMATCH);
+
+      const uint64_t nonce = b.next_nonce;
+      bridgetable.modify(b, same_payer, [&](auto &r) {
+         r.locked += quantity;
+         ++r.next_nonce;
+      });
+
+      sub_balance(from, quantity);
+      lock_custody(quantity);
+
+      SEND_INLINE_ACTION(*this, outlog, {{_self, "active"_n}},
+                         {nonce, from, quantity, recipient});
+   }
+
+   // event only, lets relayers follow lockouts from the action traces of this contract
+   ACTION outlog(uint64_t nonce, name from, asset quantity, string recipient)
+   {
+      require_auth(_self);
+   }
+
+   ACTION mintin(name submitter, vector<bridge_deposit> deposits, signature sig)
+   {
+      assert_status(CONFIG_TRANSFER_STATUS);
+      require_auth(submitter);
+      eosio_assert_code(!deposits.empty(), ERR_EMPTY_BATCH);
+
+      const auto sym = deposits.front().quantity.symbol;
+      bridges bridgetable(_self, _self.value);
+      const auto &b = get_row(bridgetable, sym.code().raw(), ERR_BRIDGE_NOT_FOUND);
+
+      // one relayer signature covers the whole batch
+      auto data = pack(std::make_tuple(_self, "bridge"_n, deposits));
+      assert_recover_key(sha256(data.data(), data.size()), sig, b.relayer);
+
+      bridgebits bittable(_self, sym.code().raw());
+      asset total(0, sym);
+      for (const auto &d : deposits)
+      {
+         eosio_assert_code(d.quantity.symbol == b.locked.symbol, ERR_SYMBOL_MISMATCH);
+         eosio_assert_code(d.quantity.amount > 0, ERR_QUANTITY_NOT_POSITIVE);
+         eosio_assert_code(is_account(d.to), ERR_ACCOUNT_NOT_FOUND);
+         eosio_assert_code(set_bit(bittable, d.nonce, submitter), ERR_DEPOSIT_PROCESSED);
+         total += d.quantity;
+      }
+      eosio_assert_code(total <= b.locked, ERR_BRIDGE_EXCEEDED);
+
+      bridgetable.modify(b, same_payer, [&](auto &r) {
+         r.locked -= total;
+      });
+
+      // no notifications: one recipient rejecting them would fail the whole signed batch
+      release_lock_balance(_self, total, total);
+      for (const auto &d : deposits)
+         add_balance(d.to, d.quantity, submitter);
+   }
+
+#pragma endregion
+#endif
+
+#if TOKEN_FEATURE_EVENT_LOG
+#pragma region event
+
+   ACTION setevtlog(uint64_t capacity)
+   {
+      require_auth(_self);
+
+      eventstates statetable(_self, _self.value);
+      auto itr = statetable.find(0);
+      if (itr == statetable.end())
+      {
+         statetable.emplace(_self, [&](auto &e) {
+            e.capacity = capacity;
+            e.next_seq = 0;
+         });
+      }
+      else
+      {
+         statetable.modify(itr, same_payer, [&](auto &e) {
+            e.capacity = capacity;
+         });
+      }
+
+      // slots beyond a reduced capacity would never be overwritten again
+      events eventtable(_self, _self.value);
+      for (auto evt = eventtable.lower_bound(capacity); evt != eventtable.end();)
+         evt = eventtable.erase(evt);
+   }
+
+#pragma endregion
+#endif
+
+#pragma region TABLE
+
+   // token bucket limiting how much may leave an account, refilled lazily on use
+   struct outflow_limit
+   {
+      int64_t capacity;
+      int64_t refill_rate;
+      int64_t tokens;
+      uint32_t last_refill;
+   };
+
+   TABLE account
+   {
+      asset balance;
+      asset lock_balance;
+      asset stake_balance;
+      binary_extension<outflow_limit> limit;
+
+      uint64_t primary_key() const { return balance.symbol.code().raw(); }
+   };
+
+   // reference to a balance tree node: a holder leaf (level 0, key = name) or a branch node
+   // (key = name >> level), with the node's hash and balance sum so parents are rehashed
+   // without reading it
+   struct tree_child
+   {
+      uint8_t level;
+      uint64_t key;
+      checksum256 hash;
+      int64_t sum;
+   };
+
+   struct inflation_schedule
+   {
+      uint32_t annual_rate;
+      name recipient;
+      uint32_t last_claim;
+   };
+
+   TABLE currency_stats
+   {
+      asset supply;
+      asset max_supply;
+      name issuer;
+      binary_extension<inflation_schedule> inflation;
+      binary_extension<tree_child> balance_root;
+
+      uint64_t primary_key() const { return supply.symbol.code().raw(); }
+   };
+
+   TABLE config_table
+   {
+      name key;
+      string value;
+
+      uint64_t primary_key() const { return key.value; }
+   };
+
+   TABLE stake_stats
+   {
+      asset staking;
+      asset unstaking;
+
+      uint64_t primary_key() const { return staking.symbol.code().raw(); }
+   };
+
+   TABLE staking_log
+   {
+      name user;
+      asset asset;
+
+      uint64_t primary_key() const { return user.value; }
+   };
+
+   TABLE unstaking_log
+   {
+      name user;
+      asset asset;
+      uint64_t request_time;
+
+      uint64_t primary_key() const { return user.value; }
+   };
+
+   TABLE voucher_key
+   {
+      name owner;
+      public_key key;
+
+      uint64_t primary_key() const { return owner.value; }
+   };
+
+   TABLE voucher_nonce
+   {
+      name to;
+      uint64_t nonce;
+
+      uint64_t primary_key() const { return to.value; }
+   };
+
+   TABLE chain_info
+   {
+      checksum256 chain_id;
+
+      uint64_t primary_key() const { return 0; }
+   };
+
+   TABLE channel
+   {
+      uint64_t id;
+      name sender;
+      name recipient;
+      asset deposit;
+      uint32_t expires;
+      public_key sender_key;
+
+      uint64_t primary_key() const { return id; }
+   };
+
+   TABLE channel_state
+   {
+      uint64_t next_id;
+
+      uint64_t primary_key() const { return 0; }
+   };
+
+   TABLE drop
+   {
+      uint64_t id;
+      name creator;
+      asset remaining;
+      checksum256 root;
+
+      uint64_t primary_key() const { return id; }
+   };
+
+   // 64 flags per row, row `word` holds the flags for indexes [word * 64, word * 64 + 63]
+   TABLE bitmap_word
+   {
+      uint64_t word;
+      uint64_t bits;
+
+      uint64_t primary_key() const { return word; }
+   };
+
+   TABLE subscription
+   {
+      uint64_t id;
+      name payer;
+      name payee;
+      asset quantity;
+      uint32_t interval;
+      uint32_t next_due;
+
+      uint64_t primary_key() const { return id; }
+      uint64_t by_due() const { return next_due; }
+   };
+
+   TABLE supply_cap
+   {
+      uint32_t effective;
+      asset max_supply;
+
+      uint64_t primary_key() const { return effective; }
+   };
+
+   TABLE supply_change
+   {
+      uint64_t id;
+      uint8_t kind;
+      asset supply;
+      asset max_supply;
+      uint32_t time;
+
+      uint64_t primary_key() const { return id; }
+   };
+
+   TABLE tree_node
+   {
+      uint64_t id;
+      tree_child left;
+      tree_child right;
+
+      uint64_t primary_key() const { return id; }
+   };
+
+   TABLE stream
+   {
+      uint64_t id;
+      name sender;
+      name recipient;
+      asset rate;
+      asset withdrawn;
+      uint32_t start;
+      uint32_t stop;
+
+      uint64_t primary_key() const { return id; }
+   };
+
+   TABLE escrow
+   {
+      uint64_t id;
+      name buyer;
+      name seller;
+      asset quantity;
+      uint32_t expires;
+
+      uint64_t primary_key() const { return id; }
+      uint64_t by_expiry() const { return expires; }
+   };
+
+   TABLE bridge_config
+   {
+      asset locked;
+      public_key relayer;
+      uint64_t next_nonce;
+
+      uint64_t primary_key() const { return locked.symbol.code().raw(); }
+   };
+
+   TABLE event_state
+   {
+      uint64_t capacity;
+      uint64_t next_seq;
+
+      uint64_t primary_key() const { return 0; }
+   };
+
+   TABLE event
+   {
+      uint64_t slot;
+      uint64_t seq;
+      uint8_t kind;
+      name from;
+      name to;
+      asset quantity;
+      uint32_t time;
+
+      uint64_t primary_key() const { return slot; }
+   };
+
+   typedef multi_index<"config"_n, config_table> configs;
+
+   typedef multi_index<"stakestats"_n, stake_stats> stakestats;
+   typedef multi_index<"stakinglog"_n, staking_log> stakinglog;
+   typedef multi_index<"unstakinglog"_n, unstaking_log> unstakinglog;
+
+   // declared for the ABI, rows are accessed through find_account/read_account/write_account
+   typedef multi_index<"accounts"_n, account> accounts;
+   typedef multi_index<"stat"_n, currency_stats> stats;
+   typedef multi_index<"supplycaps"_n, supply_cap> supplycaps;
+   typedef multi_index<"supplylog"_n, supply_change> supplylog;
+   typedef multi_index<"smtnodes"_n, tree_node> smtnodes;
+
+   typedef multi_index<"vouchkeys"_n, voucher_key> voucherkeys;
+   typedef multi_index<"vouchnonce"_n, voucher_nonce> vouchernonces;
+   typedef multi_index<"chaininfo"_n, chain_info> chaininfos;
+   typedef multi_index<"channels"_n, channel> channels;
+   typedef multi_index<"chstate"_n, channel_state> channelstates;
+   typedef multi_index<"streams"_n, stream> streams;
+   typedef multi_index<"escrows"_n, escrow,
+                       indexed_by<"byexpiry"_n, const_mem_fun<escrow, uint64_t, &escrow::by_expiry>>>
+       escrows;
+
+   typedef multi_index<"drops"_n, drop> drops;
+   typedef multi_index<"claimbits"_n, bitmap_word> claimbits;
+
+   typedef multi_index<"bridges"_n, bridge_config> bridges;
+   typedef multi_index<"bridgebits"_n, bitmap_word> bridgebits;
+
+   typedef multi_index<"eventstate"_n, event_state> eventstates;
+   typedef multi_index<"events"_n, event> events;
+
+   typedef multi_index<"subs"_n, subscription,
+                       indexed_by<"bydue"_n, const_mem_fun<subscription, uint64_t, &subscription::by_due>>>
+       subscriptions;
+
+#pragma endregion
+
+private:
+   configs configtable;
+
+   const name CONFIG_INIT = "init"_n;
+   const name CONFIG_STAKE_STATUS = "sstatus"_n;
+   const name CONFIG_ISSUE_STATUS = "istatus"_n;
+   const name CONFIG_TRANSFER_STATUS = "tstatus"_n;
+   const name CONFIG_UNSTAKE_TIME = "unstaketime"_n;
+
+   const name ACCOUNTS_TABLE = "accounts"_n;
+
+   // three assets plus the optional outflow limit fit comfortably
+   static constexpr uint32_t ACCOUNT_ROW_CAPACITY = 128;
+
+   static constexpr int64_t SECONDS_PER_YEAR = 365 * 24 * 3600;
+
+   static constexpr uint8_t SUPPLY_SET_CAP = 0;
+   static constexpr uint8_t SUPPLY_SCHEDULED_CAP = 1;
+   static constexpr uint8_t SUPPLY_BURN_UNISSUED = 2;
+
+   static constexpr uint8_t EVENT_TRANSFER = 0;
+   static constexpr uint8_t EVENT_ISSUE = 1;
+   static constexpr uint8_t EVENT_RETIRE = 2;
+
+   // outflow still permitted by the account's token bucket at the current block time
+   int64_t outflow_allowance(const account &a)
+   {
+#if TOKEN_FEATURE_OUTFLOW_LIMIT
+      if (!a.limit.has_value() || a.limit.value().capacity == 0)
+         return std::numeric_limits<int64_t>::max();
+
+      const auto &l = a.limit.value();
+      const uint32_t now = current_time_point().sec_since_epoch();
+      if (now <= l.last_refill)
+         return l.tokens;
+
+      const int128_t refilled = int128_t(l.tokens) + int128_t(now - l.last_refill) * l.refill_rate;
+      return refilled > l.capacity ? l.capacity : int64_t(refilled);
+#else
+      return std::numeric_limits<int64_t>::max();
+#endif
+   }
+
+   void consume_outflow(account & a, int64_t amount)
+   {
+#if TOKEN_FEATURE_OUTFLOW_LIMIT
+      if (!a.limit.has_value() || a.limit.value().capacity == 0)
+         return;
+
+      const int64_t tokens = outflow_allowance(a);
+      eosio_assert_code(tokens >= amount, ERR_OUTFLOW_LIMIT);
+
+      auto &l = a.limit.value();
+      l.tokens = tokens - amount;
+      l.last_refill = current_time_point().sec_since_epoch();
+#endif
+   }
+
+   // applies every scheduled cap that became effective, never below the current supply
+   void apply_supply_caps(stats & statstable, const currency_stats &st, name ram_payer)
+   {
+#if TOKEN_FEATURE_SUPPLY_SCHEDULE
+      supplycaps captable(_self, st.supply.symbol.code().raw());
+      const uint32_t now = current_time_point().sec_since_epoch();
+
+      for (auto itr = captable.begin(); itr != captable.end() && itr->effective <= now; itr = captable.erase(itr))
+      {
+         statstable.modify(st, same_payer, [&](auto &s) {
+            s.max_supply.amount = std::max(itr->max_supply.amount, s.supply.amount);
+         });
+         // logged at the time the cap took effect, not when it was applied
+         log_supply(st, SUPPLY_SCHEDULED_CAP, itr->effective, ram_payer);
+      }
+#endif
+   }
+
+   void log_supply(const currency_stats &st, uint8_t kind, uint32_t time, name ram_payer)
+   {
+#if TOKEN_FEATURE_SUPPLY_SCHEDULE
+      supplylog logtable(_self, st.supply.symbol.code().raw());
+      logtable.emplace(ram_payer, [&](auto &l) {
+         l.id = logtable.available_primary_key();
+         l.kind = kind;
+         l.supply = st.supply;
+         l.max_supply = st.max_supply;
+         l.time = time;
+      });
+#endif
+   }
+
+   // adds to supply what the schedule accrued since the last claim, computed from elapsed time;
+   // the caller credits the recipient once it no longer writes the stats row
+   asset accrue_inflation(stats & statstable, const currency_stats &st)
+   {
+      const auto &inf = st.inflation.value();
+      const uint32_t now = current_time_point().sec_since_epoch();
+
+      asset pending(0, st.supply.symbol);
+      if (now > inf.last_claim)
+      {
+         const int128_t accrued = int128_t(st.supply.amount) * inf.annual_rate * (now - inf.last_claim) / (int128_t(10000) * SECONDS_PER_YEAR);
+         pending.amount = int64_t(std::min<int128_t>(accrued, st.max_supply.amount - st.supply.amount));
+      }
+      if (pending.amount == 0)
+         return pending;
+
+      statstable.modify(st, same_payer, [&](auto &s) {
+         s.supply += pending;
+         s.inflation.value().last_claim = now;
+      });
+      return pending;
+   }
+
+   // writes into the next slot of the ring buffer when the event log is enabled
+   void append_event(uint8_t kind, name from, name to, const asset &quantity)
+   {
+#if TOKEN_FEATURE_EVENT_LOG
+      eventstates statetable(_self, _self.value);
+      auto state = statetable.find(0);
+      if (state == statetable.end() || state->capacity == 0)
+         return;
+
+      const uint64_t seq = state->next_seq;
+      const uint64_t slot = seq % state->capacity;
+      statetable.modify(state, same_payer, [&](auto &e) {
+         ++e.next_seq;
+      });
+
+      auto fill = [&](auto &e) {
+         e.slot = slot;
+         e.seq = seq;
+         e.kind = kind;
+         e.from = from;
+         e.to = to;
+         e.quantity = quantity;
+         e.time = current_time_point().sec_since_epoch();
+      };
+
+      events eventtable(_self, _self.value);
+      auto evt = eventtable.find(slot);
+      if (evt == eventtable.end())
+         eventtable.emplace(_self, fill);
+      else
+         eventtable.modify(evt, same_payer, fill);
+#endif
+   }
+
+   // multi_index::get, failing with an error code instead of a message string
+   template <typename Table>
+   const auto &get_row(Table & table, uint64_t key, uint64_t code)
+   {
+      auto itr = table.find(key);
+      eosio_assert_code(itr != table.end(), code);
+      return *itr;
+   }
+
+   void sub_balance(name owner, asset value)
+   {
+      int32_t itr;
+      account from = get_account(owner, value.symbol.code(), itr);
+      eosio_assert_code(from.balance.amount - from.lock_balance.amount - from.stake_balance.amount >= value.amount, ERR_OVERDRAWN);
+
+      auto payer = has_auth(owner) ? owner : same_payer;
+
+      const asset before = from.balance;
+      consume_outflow(from, value.amount);
+      from.balance -= value;
+      write_account(owner, itr, from, payer);
+      commit_balance(owner, before, from.balance, same_payer);
+   }
+
+   void add_balance(name owner, asset value, name ram_payer)
+   {
+      const int32_t itr = find_account(owner, value.symbol.code());
+      if (itr < 0)
+      {
+         account to;
+         to.balance = value;
+         to.lock_balance = asset(0, value.symbol);
+         to.stake_balance = asset(0, value.symbol);
+         write_account(owner, itr, to, ram_payer);
+         commit_balance(owner, asset(0, value.symbol), value, ram_payer);
+      }
+      else
+      {
+         account to = read_account(itr);
+         const asset before = to.balance;
+         to.balance += value;
+         write_account(owner, itr, to, same_payer);
+         commit_balance(owner, before, to.balance, same_payer);
+      }
+   }
+
+   // `accounts` rows are read and written with the db intrinsics directly: the fixed-layout
+   // row is decoded into a stack object, with no multi_index item cache or heap allocation
+   int32_t find_account(name owner, symbol_code sym)
+   {
+      return db_find_i64(_self.value, owner.value, ACCOUNTS_TABLE.value, sym.raw());
+   }
+
+   account read_account(int32_t itr)
+   {
+      char buf[ACCOUNT_ROW_CAPACITY];
+      const int32_t size = db_get_i64(itr, buf, sizeof(buf));
+      eosio_assert_code(size <= int32_t(sizeof(buf)), ERR_ACCOUNT_ROW_TOO_LARGE);
+
+      account row;
+      datastream<const char *> ds(buf, size);
+      ds >> row;
+      return row;
+   }
+
+   account get_account(name owner, symbol_code sym, int32_t & itr)
+   {
+      itr = find_account(owner, sym);
+      eosio_assert_code(itr >= 0, ERR_NO_BALANCE);
+      return read_account(itr);
+   }
+
+   // updates the row at `itr`, or stores a new row when `itr` is negative
+   void write_account(name owner, int32_t itr, const account &row, name payer)
+   {
+      char buf[ACCOUNT_ROW_CAPACITY];
+      datastream<char *> ds(buf, sizeof(buf));
+      ds << row;
+
+      if (itr < 0)
+         db_store_i64(owner.value, ACCOUNTS_TABLE.value, payer.value, row.primary_key(), buf, ds.tellp());
+      else
+         db_update_i64(itr, payer.value, buf, ds.tellp());
+   }
+
+   // keeps the symbol's balance tree in step with one holder's balance change;
+   // `ram_payer` is the payer of a row just stored, and same_payer for an existing row
+   void commit_balance(name owner, const asset &before, const asset &after, name ram_payer)
+   {
+      if (before == after && ram_payer == same_payer)
+         return;
+
+      update_balance_tree(owner, after, ram_payer);
+   }
+
+   // binary radix tree over account names that stores branch nodes only, one per holder after
+   // the first. A branch at `level` splits the names with prefix name >> level on bit level - 1
+   // and is stored under id (1 << (64 - level)) | prefix; a subtree with one holder is that
+   // holder's leaf, hash(owner, balance), rebuilt from the account row. A holder's branch is
+   // created together with its account row and billed to the same payer, so later balance
+   // changes only modify the branches on the path, about log2(holders) of them.
+   void update_balance_tree(name owner, const asset &balance, name ram_payer)
+   {
+      const auto sym = balance.symbol.code();
+      stats statstable(_self, sym.raw());
+      const auto &st = get_row(statstable, sym.raw(), ERR_TOKEN_NOT_FOUND);
+#if !TOKEN_FEATURE_BALANCE_TREE
+      // a token created by a build with the tree would be left with a stale root that a later
+      // build with the tree keeps extending, so such a token cannot change balances here
+      eosio_assert_code(!st.balance_root.has_value(), ERR_BALANCE_TREE_DISABLED);
+#else
+      if (!st.balance_root.has_value())
+         return;
+
+      smtnodes nodetable(_self, sym.raw());
+
+      // branches from the root down to the holder's leaf, or to where it is attached
+      vector<tree_child> path;
+      tree_child cur = st.balance_root.value();
+      while (cur.level > 0 && tree_prefix(owner.value, cur.level) == cur.key)
+      {
+         path.push_back(cur);
+         const auto &n = get_row(nodetable, tree_node_id(cur.level, cur.key), ERR_TREE_NODE_NOT_FOUND);
+         cur = tree_side(owner.value, cur.level) ? n.right : n.left;
+      }
+
+      tree_child node{0, owner.value, holder_digest(owner, balance), balance.amount};
+      if (cur.hash != checksum256() && !(cur.level == 0 && cur.key == owner.value))
+      {
+         // a new holder splits `cur` off at the highest bit where the names differ
+         const uint64_t other = cur.level == 0 ? cur.key : cur.key << cur.level;
+         const uint8_t level = 64 - __builtin_clzll(owner.value ^ other);
+         const bool right = tree_side(owner.value, level);
+
+         tree_node branch{tree_node_id(level, tree_prefix(owner.value, level)), right ? cur : node, right ? node : cur};
+         nodetable.emplace(ram_payer, [&](auto &n) {
+            n = branch;
+         });
+         node = branch_child(level, tree_prefix(owner.value, level), branch.left, branch.right);
+      }
+
+      for (auto p = path.rbegin(); p != path.rend(); ++p)
+      {
+         const auto &n = get_row(nodetable, tree_node_id(p->level, p->key), ERR_TREE_NODE_NOT_FOUND);
+         nodetable.modify(n, same_payer, [&](auto &r) {
+            (tree_side(owner.value, p->level) ? r.right : r.left) = node;
+            node = branch_child(p->level, p->key, r.left, r.right);
+         });
+      }
+
+      statstable.modify(st, same_payer, [&](auto &s) {
+         s.balance_root.value() = node;
+      });
+#endif
+   }
+
+   uint64_t tree_prefix(uint64_t value, uint8_t level)
+   {
+      return level == 64 ? 0 : value >> level;
+   }
+
+   uint64_t tree_node_id(uint8_t level, uint64_t prefix)
+   {
+      return (1ULL << (64 - level)) | prefix;
+   }
+
+   // true when `value` lies in the right subtree of a branch at `level`
+   bool tree_side(uint64_t value, uint8_t level)
+   {
+      return (value >> (level - 1)) & 1;
+   }
+
+   // merkle-sum branch: both child sums are hashed in, so a holder's inclusion proof (the sibling
+   // level, hash and sum at each branch) also shows its balance is counted in the root sum, which
+   // equals supply; the level fixes where each branch sits
+   tree_child branch_child(uint8_t level, uint64_t prefix, const tree_child &left, const tree_child &right)
+   {
+      auto data = pack(std::make_tuple(level, left.hash, left.sum, right.hash, right.sum));
+      return tree_child{level, prefix, sha256(data.data(), data.size()), left.sum + right.sum};
+   }
+
+   checksum256 holder_digest(name owner, const asset &balance)
+   {
+      auto data = pack(std::make_tuple(owner, balance));
+      return sha256(data.data(), data.size());
+   }
+
+   checksum256 voucher_digest(const voucher &v)
+   {
+      // bind the signature to this contract on this chain so vouchers cannot be replayed elsewhere
+      auto data = pack(std::make_tuple(chain_id(), _self, v.from, v.to, v.quantity, v.nonce));
+      return sha256(data.data(), data.size());
+   }
+
+   checksum256 chain_id()
+   {
+      chaininfos chaintable(_self, _self.value);
+      return get_row(chaintable, 0, ERR_CHAIN_ID_NOT_SET).chain_id;
+   }
+
+   void assert_voucher_sig(name signer, const checksum256 &digest, const signature &sig)
+   {
+      voucherkeys keytable(_self, _self.value);
+      const auto &k = get_row(keytable, signer.value, ERR_VOUCHER_KEY_NOT_FOUND);
+      assert_recover_key(digest, sig, k.key);
+   }
+
+   uint64_t get_voucher_nonce(name from, name to)
+   {
+      vouchernonces noncetable(_self, from.value);
+      auto itr = noncetable.find(to.value);
+      return itr == noncetable.end() ? 0 : itr->nonce;
+   }
+
+   void set_voucher_nonce(name from, name to, uint64_t nonce, name ram_payer)
+   {
+      vouchernonces noncetable(_self, from.value);
+      auto itr = noncetable.find(to.value);
+      if (itr == noncetable.end())
+      {
+         noncetable.emplace(ram_payer, [&](auto &n) {
+            n.to = to;
+            n.nonce = nonce;
+         });
+      }
+      else
+      {
+         noncetable.modify(itr, same_payer, [&](auto &n) {
+            n.nonce = nonce;
+         });
+      }
+   }
+
+   checksum256 channel_digest(const channel &c, const asset &quantity)
+   {
+      auto data = pack(std::make_tuple(chain_id(), _self, "channel"_n, c.id, c.sender, c.recipient, c.deposit, quantity));
+      return sha256(data.data(), data.size());
+   }
+
+   // folds a proof into the leaf using sorted pairs, so proofs carry no left/right flags
+   checksum256 merkle_root(checksum256 node, const vector<checksum256> &proof)
+   {
+      char buf[64];
+      for (const auto &sibling : proof)
+      {
+         auto lo = node < sibling ? node.extract_as_byte_array() : sibling.extract_as_byte_array();
+         auto hi = node < sibling ? sibling.extract_as_byte_array() : node.extract_as_byte_array();
+         memcpy(buf, lo.data(), 32);
+         memcpy(buf + 32, hi.data(), 32);
+         node = sha256(buf, sizeof(buf));
+      }
+      return node;
+   }
+
+   // sets flag `index` in a bitmap_word table, returns false if it was already set
+   template <typename Bitmap>
+   bool set_bit(Bitmap & bitmap, uint64_t index, name ram_payer)
+   {
+      const uint64_t mask = 1ULL << (index % 64);
+      auto itr = bitmap.find(index / 64);
+      if (itr == bitmap.end())
+      {
+         bitmap.emplace(ram_payer, [&](auto &w) {
+            w.word = index / 64;
+            w.bits = mask;
+         });
+         return true;
+      }
+      if (itr->bits & mask)
+         return false;
+
+      bitmap.modify(itr, same_payer, [&](auto &w) {
+         w.bits |= mask;
+      });
+      return true;
+   }
+
+   // pays the seller from the buyer's locked funds, or just unlocks them on refund
+   void close_escrow(escrows & escrowtable, const escrow &e, bool to_seller)
+   {
+      const name buyer = e.buyer;
+      const name seller = e.seller;
+      const asset quantity = e.quantity;
+      escrowtable.erase(e);
+
+      release_lock_balance(buyer, quantity, to_seller ? quantity : asset(0, quantity.symbol));
+      if (to_seller)
+         add_balance(seller, quantity, _self);
+   }
+
+   // total paid out by a stream at the current block time
+   asset streamed(const stream &s)
+   {
+      const uint32_t now = current_time_point().sec_since_epoch();
+      if (now <= s.start)
+         return asset(0, s.rate.symbol);
+
+      return s.rate * int64_t(std::min(now, s.stop) - s.start);
+   }
+
+   void add_lock_balance(name owner, asset value)
+   {
+      int32_t itr;
+      account acnt = get_account(owner, value.symbol.code(), itr);
+      eosio_assert_code(acnt.balance.amount - acnt.lock_balance.amount - acnt.stake_balance.amount >= value.amount, ERR_OVERDRAWN);
+
+      // funds committed to an escrow count as outflow when they are locked
+      consume_outflow(acnt, value.amount);
+      acnt.lock_balance += value;
+      write_account(owner, itr, acnt, same_payer);
+   }
+
+   // funds held by the contract (airdrop pools, bridged-out tokens) are locked in its own row
+   void lock_custody(asset value)
+   {
+      const int32_t itr = find_account(_self, value.symbol.code());
+      if (itr < 0)
+      {
+         account acnt;
+         acnt.balance = value;
+         acnt.lock_balance = value;
+         acnt.stake_balance = asset(0, value.symbol);
+         write_account(_self, itr, acnt, _self);
+         commit_balance(_self, asset(0, value.symbol), value, _self);
+      }
+      else
+      {
+         account acnt = read_account(itr);
+         const asset before = acnt.balance;
+         acnt.balance += value;
+         acnt.lock_balance += value;
+         write_account(_self, itr, acnt, same_payer);
+         commit_balance(_self, before, acnt.balance, same_payer);
+      }
+   }
+
+   // unlocks `locked` and removes `spent` (part of it) from the balance in one row update
+   void release_lock_balance(name owner, asset locked, asset spent)
+   {
+      int32_t itr;
+      account acnt = get_account(owner, locked.symbol.code(), itr);
+      eosio_assert_code(acnt.lock_balance >= locked, ERR_OVERDRAWN_LOCK);
+
+      const asset before = acnt.balance;
+      acnt.lock_balance -= locked;
+      acnt.balance -= spent;
+      write_account(owner, itr, acnt, same_payer);
+      commit_balance(owner, before, acnt.balance, same_payer);
+   }
+
+   bool status_enabled(name key)
+   {
+      auto itr = configtable.find(key.value);
+      return itr != configtable.end() && parse_config_uint(itr->value) > 0;
+   }
+
+   void assert_status(name key)
+   {
+      eosio_assert_code(status_enabled(key), ERR_STATUS_DISABLED);
+   }
+
+   uint64_t get_unstake_time()
+   {
+      auto unstake_time = configtable.find(CONFIG_UNSTAKE_TIME.value);
+      eosio_assert_code(unstake_time != configtable.end(), ERR_UNSTAKE_TIME_NOT_SET);
+
+      return parse_config_uint(unstake_time->value);
+   }
+
+   // decimal digits only, so no libc++ number parsing or exception paths end up in the wasm
+   uint64_t parse_config_uint(const string &value)
+   {
+      eosio_assert_code(!value.empty() && value.size() <= 19, ERR_INVALID_CONFIG_VALUE);
+
+      uint64_t result = 0;
+      for (char c : value)
+      {
+         eosio_assert_code(c >= '0' && c <= '9', ERR_INVALID_CONFIG_VALUE);
+         result = result * 10 + uint64_t(c - '0');
+      }
+      return result;
    }
 
    void set_config(name key, string value)
@@ -308,4 +1989,60 @@ private:
    }
 };
 
-EOSIO_DISPATCH(token, (init)(create)(issue)(transfer)(reduceto)(retire))
\ No newline at end of file
+#if TOKEN_FEATURE_VOUCHER
+#define TOKEN_VOUCHER_ACTIONS (setchainid)(regvkey)(settle)
+#else
+#define TOKEN_VOUCHER_ACTIONS
+#endif
+#if TOKEN_FEATURE_CHANNEL
+#define TOKEN_CHANNEL_ACTIONS (chopen)(chclose)
+#else
+#define TOKEN_CHANNEL_ACTIONS
+#endif
+#if TOKEN_FEATURE_AIRDROP
+#define TOKEN_AIRDROP_ACTIONS (mkdrop)(claim)(closedrop)
+#else
+#define TOKEN_AIRDROP_ACTIONS
+#endif
+#if TOKEN_FEATURE_SUBSCRIPTION
+#define TOKEN_SUBSCRIPTION_ACTIONS (subscribe)(unsubscribe)(execute)
+#else
+#define TOKEN_SUBSCRIPTION_ACTIONS
+#endif
+#if TOKEN_FEATURE_OUTFLOW_LIMIT
+#define TOKEN_OUTFLOW_LIMIT_ACTIONS (setlimit)
+#else
+#define TOKEN_OUTFLOW_LIMIT_ACTIONS
+#endif
+#if TOKEN_FEATURE_INFLATION
+#define TOKEN_INFLATION_ACTIONS (setinflation)(inflate)
+#else
+#define TOKEN_INFLATION_ACTIONS
+#endif
+#if TOKEN_FEATURE_SUPPLY_SCHEDULE
+#define TOKEN_SUPPLY_SCHEDULE_ACTIONS (schedcap)(burnunissued)
+#else
+#define TOKEN_SUPPLY_SCHEDULE_ACTIONS
+#endif
+#if TOKEN_FEATURE_STREAM
+#define TOKEN_STREAM_ACTIONS (mkstream)(withdraw)(cancelstream)
+#else
+#define TOKEN_STREAM_ACTIONS
+#endif
+#if TOKEN_FEATURE_ESCROW
+#define TOKEN_ESCROW_ACTIONS (mkescrow)(release)(refund)(releasebatch)
+#else
+#define TOKEN_ESCROW_ACTIONS
+#endif
+#if TOKEN_FEATURE_BRIDGE
+#define TOKEN_BRIDGE_ACTIONS (setrelayer)(lockout)(outlog)(mintin)
+#else
+#define TOKEN_BRIDGE_ACTIONS
+#endif
+#if TOKEN_FEATURE_EVENT_LOG
+#define TOKEN_EVENT_LOG_ACTIONS (setevtlog)
+#else
+#define TOKEN_EVENT_LOG_ACTIONS
+#endif
+
+EOSIO_DISPATCH(token, (init)(create)(issue)(transfer)(reduceto)(retire) TOKEN_VOUCHER_ACTIONS TOKEN_CHANNEL_ACTIONS TOKEN_AIRDROP_ACTIONS TOKEN_SUBSCRIPTION_ACTIONS TOKEN_OUTFLOW_LIMIT_ACTIONS TOKEN_INFLATION_ACTIONS TOKEN_SUPPLY_SCHEDULE_ACTIONS TOKEN_STREAM_ACTIONS TOKEN_ESCROW_ACTIONS TOKEN_BRIDGE_ACTIONS TOKEN_EVENT_LOG_ACTIONS)
\ No newline at end of file